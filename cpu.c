@@ -0,0 +1,49 @@
+// cpu.c - Runtime CPU feature detection implementation
+
+#include "cpu.h"
+#include <stdio.h>
+#include <string.h>
+
+static CpuLevel level = CPU_SCALAR;
+
+static const char *level_names[] = {"scalar", "sse2", "avx2", "avx512"};
+
+static CpuLevel detect(void) {
+#if CPU_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl"))
+    return CPU_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return CPU_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return CPU_SSE2;
+#endif
+  return CPU_SCALAR;
+}
+
+int cpu_init(const char *force) {
+  CpuLevel best = detect();
+  level = best;
+  if (!force || !*force)
+    return 1;
+
+  for (int i = 0; i <= CPU_AVX512; i++) {
+    if (strcmp(force, level_names[i]))
+      continue;
+    if ((CpuLevel)i > best) {
+      fprintf(stderr, "This CPU does not support %s kernels (best: %s)\n",
+              force, level_names[best]);
+      return 0;
+    }
+    level = (CpuLevel)i;
+    return 1;
+  }
+
+  fprintf(stderr, "Unknown instruction set '%s'\n", force);
+  return 0;
+}
+
+CpuLevel cpu_level(void) { return level; }
+
+const char *cpu_level_name(CpuLevel l) { return level_names[l]; }
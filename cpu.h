@@ -0,0 +1,36 @@
+// cpu.h - Runtime CPU feature detection for kernel dispatch
+
+#ifndef CPU_H
+#define CPU_H
+
+// Instruction set levels the hot kernels are built for, in increasing order
+typedef enum {
+  CPU_SCALAR,
+  CPU_SSE2,
+  CPU_AVX2,
+  CPU_AVX512,
+} CpuLevel;
+
+// On x86 every level is compiled into the binary through target attributes
+// and picked at startup, elsewhere only the scalar kernels exist
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2")))
+#else
+#define CPU_X86 0
+#endif
+
+// Detect the best level this CPU supports. `force` names a level to use
+// instead ("scalar", "sse2", "avx2" or "avx512"), returns 0 if it is unknown
+// or not supported.
+int cpu_init(const char *force);
+
+// Level selected by cpu_init()
+CpuLevel cpu_level(void);
+
+// Printable name of a level
+const char *cpu_level_name(CpuLevel level);
+
+#endif // CPU_H
@@ -1,16 +1,36 @@
 // frame_generator.c - Background frame generation implementation
 
 #include "frame_generator.h"
+#include "cpu.h"
 #include "voronoi.h"
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
 // Constants
 const int FPS = 12;
 const float frame_dt = 1.0f / 12.0f;
 const int PREG = 144;
+const float BOIL_STRENGTH = 4.0f;
+const float BOIL_FREQ = 0.04f;
+
+// Boil time per second of animation
+static const float BOIL_TIME_SCALE = 0.3f;
+
+int g_boil_phases = 0;
+int g_boil_glyph_cache = 0;
+int g_boil_reuse_fields = 0;
+int g_tile_threads = 0;
+int g_buffer_frames = 144;
 
 // Window dimensions
 int WIN_W = 1600;
@@ -32,41 +52,229 @@ int g_line_count = sizeof(g_lines) / sizeof(g_lines[0]);
 int g_line_gap = 30;
 
 // Background thread state
-uint32_t **framesB_pixels = NULL;
-int framesB_pixels_size = 0;
-int framesB_pixels_cap = 0;
-int bg_keep_running = 1;
-pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+atomic_int bg_keep_running = 1;
 GlyphCache *g_bg_cache = NULL;
 
-// TODO: Optimize this function somehow
-static void blit_glyph_to_pixels(uint32_t *dest, int dest_w, int dest_h,
-                                 uint8_t *boiled, int gw, int gh, int dst_x,
-                                 int dst_y) {
-  for (int yy = 0; yy < gh; yy++) {
-    int dy = dst_y + yy;
-    if (dy < 0 || dy >= dest_h)
-      continue;
-    for (int xx = 0; xx < gw; xx++) {
-      int dx = dst_x + xx;
-      if (dx < 0 || dx >= dest_w)
-        continue;
-      uint8_t a = boiled[yy * gw + xx];
-      if (a == 0)
-        continue;
-      dest[dy * dest_w + dx] = 0xFFFFFF00u | (uint32_t)a;
+// One glyph of the laid out text, everything a frame needs to draw it
+typedef struct {
+  int glyph;          // index in GlyphCache.glyphs
+  int column;         // character column, its glyphs share a boil field
+  float offset;       // boil time offset of the column
+  int w, h;           // glyph size
+  int x, y;           // frame position of the glyph's top-left corner
+  int x0, y0, x1, y1; // part of the glyph box inside the frame
+} DrawCmd;
+
+// Composite glyph coverage `a` into a frame pixel. Inked pixels are white
+// with alpha a, so taking the larger word keeps the stronger ink where glyphs
+// overlap and leaves the pixel alone where a is 0.
+static inline uint32_t composite(uint32_t dst, uint8_t a) {
+  uint32_t p = a ? 0xFFFFFF00u | (uint32_t)a : 0;
+  return p > dst ? p : dst;
+}
+
+// Blit and boil-and-blit bodies, the portable kernels. The x86 ones below are
+// written with intrinsics. Only the visible part of the glyph is drawn.
+static inline __attribute__((always_inline)) void
+blit_glyph_body(uint32_t *dest, int dest_w, const uint8_t *boiled,
+                const DrawCmd *d) {
+  for (int yy = d->y0; yy < d->y1; yy++) {
+    uint32_t *row = dest + (d->y + yy) * dest_w + d->x;
+    const uint8_t *src = boiled + yy * d->w;
+    for (int xx = d->x0; xx < d->x1; xx++)
+      row[xx] = composite(row[xx], src[xx]);
+  }
+}
+
+// Remap the glyph through a boil field straight into the frame, without
+// boiling into a bitmap first. src is a glyph's base_bitmap, its apron keeps
+// every sample in bounds.
+static inline __attribute__((always_inline)) void
+boil_blit_glyph_body(uint32_t *dest, int dest_w, const uint8_t *src,
+                     int pitch, const BoilField *f, const DrawCmd *d) {
+  for (int y = d->y0; y < d->y1; y++) {
+    uint32_t *row = dest + (d->y + y) * dest_w + d->x;
+    const int8_t *dx = f->dx + y * f->stride;
+    const int8_t *dy = f->dy + y * f->stride;
+    for (int x = d->x0; x < d->x1; x++)
+      row[x] = composite(row[x], src[(y + dy[x]) * pitch + x + dx[x]]);
+  }
+}
+
+static void blit_glyph_scalar(uint32_t *dest, int dest_w,
+                              const uint8_t *boiled, const DrawCmd *d) {
+  blit_glyph_body(dest, dest_w, boiled, d);
+}
+
+static void boil_blit_glyph_scalar(uint32_t *dest, int dest_w,
+                                   const uint8_t *src, int pitch,
+                                   const BoilField *f, const DrawCmd *d) {
+  boil_blit_glyph_body(dest, dest_w, src, pitch, f, d);
+}
+
+#if CPU_X86
+// SSE2 has no unsigned 32-bit max, but the words only differ in their alpha
+// byte or are 0, so a bytewise max composites the same. 16 coverage bytes are
+// widened to 16 pixels at a time. The compiler doesn't vectorize the blit body
+// well even with AVX2, so this is used at every level.
+TARGET_SSE2 static void blit_glyph_sse2(uint32_t *dest, int dest_w,
+                                        const uint8_t *boiled,
+                                        const DrawCmd *d) {
+  const __m128i zero = _mm_setzero_si128();
+  for (int yy = d->y0; yy < d->y1; yy++) {
+    uint32_t *row = dest + (d->y + yy) * dest_w + d->x;
+    const uint8_t *src = boiled + yy * d->w;
+    int xx = d->x0;
+    for (; xx + 16 <= d->x1; xx += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(src + xx));
+      // 0xFF for inked pixels, it becomes their colour bytes
+      __m128i ink = _mm_andnot_si128(_mm_cmpeq_epi8(a, zero),
+                                     _mm_cmpeq_epi8(zero, zero));
+      __m128i a_lo = _mm_unpacklo_epi8(a, ink);
+      __m128i a_hi = _mm_unpackhi_epi8(a, ink);
+      __m128i ink_lo = _mm_unpacklo_epi8(ink, ink);
+      __m128i ink_hi = _mm_unpackhi_epi8(ink, ink);
+      __m128i p[4] = {
+          _mm_unpacklo_epi16(a_lo, ink_lo),
+          _mm_unpackhi_epi16(a_lo, ink_lo),
+          _mm_unpacklo_epi16(a_hi, ink_hi),
+          _mm_unpackhi_epi16(a_hi, ink_hi),
+      };
+      for (int k = 0; k < 4; k++) {
+        __m128i *o = (__m128i *)(row + xx + 4 * k);
+        _mm_storeu_si128(o, _mm_max_epu8(_mm_loadu_si128(o), p[k]));
+      }
     }
+    for (; xx < d->x1; xx++)
+      row[xx] = composite(row[xx], src[xx]);
   }
 }
 
-// TODO: Also optimize this function as well
-void render_frame_to_pixels(uint32_t *pixels, GlyphCache *cache, float t) {
-  memset(pixels, 0, WIN_W * WIN_H * sizeof(uint32_t));
+// Gather 8 samples at once and composite them with an unsigned max. 4 bytes
+// are read at each offset and the first one kept, the apron has room for the
+// 3 extra.
+TARGET_AVX2 static void boil_blit_glyph_avx2(uint32_t *dest, int dest_w,
+                                             const uint8_t *src, int pitch,
+                                             const BoilField *f,
+                                             const DrawCmd *d) {
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i vpitch = _mm256_set1_epi32(pitch);
+  const __m256i low = _mm256_set1_epi32(0xFF);
+  const __m256i white = _mm256_set1_epi32((int)0xFFFFFF00u);
+  const __m256i zero = _mm256_setzero_si256();
+  for (int y = d->y0; y < d->y1; y++) {
+    uint32_t *row = dest + (d->y + y) * dest_w + d->x;
+    const int8_t *dx = f->dx + y * f->stride;
+    const int8_t *dy = f->dy + y * f->stride;
+    __m256i vy = _mm256_set1_epi32(y);
+    int x = d->x0;
+    for (; x + 8 <= d->x1; x += 8) {
+      __m256i ox = _mm256_cvtepi8_epi32(
+          _mm_loadl_epi64((const __m128i *)(dx + x)));
+      __m256i oy = _mm256_cvtepi8_epi32(
+          _mm_loadl_epi64((const __m128i *)(dy + x)));
+      __m256i ix =
+          _mm256_add_epi32(_mm256_add_epi32(lane, _mm256_set1_epi32(x)), ox);
+      __m256i idx = _mm256_add_epi32(
+          _mm256_mullo_epi32(_mm256_add_epi32(vy, oy), vpitch), ix);
+      __m256i a = _mm256_and_si256(
+          _mm256_i32gather_epi32((const int *)src, idx, 1), low);
+      __m256i p = _mm256_andnot_si256(_mm256_cmpeq_epi32(a, zero),
+                                      _mm256_or_si256(a, white));
+      __m256i *o = (__m256i *)(row + x);
+      _mm256_storeu_si256(o, _mm256_max_epu32(_mm256_loadu_si256(o), p));
+    }
+    for (; x < d->x1; x++)
+      row[x] = composite(row[x], src[(y + dy[x]) * pitch + x + dx[x]]);
+  }
+}
+#endif
 
-  int line_y = 0;
-  const float STRENGTH = 4.0f;
-  const float FREQ = 0.04f;
+static void (*blit_glyph_to_pixels)(uint32_t *dest, int dest_w,
+                                    const uint8_t *boiled,
+                                    const DrawCmd *d) = blit_glyph_scalar;
 
+static void (*boil_blit_glyph)(uint32_t *dest, int dest_w, const uint8_t *src,
+                               int pitch, const BoilField *f,
+                               const DrawCmd *d) = boil_blit_glyph_scalar;
+
+void frame_generator_init(void) {
+#if CPU_X86
+  if (cpu_level() >= CPU_SSE2)
+    blit_glyph_to_pixels = blit_glyph_sse2;
+  if (cpu_level() >= CPU_AVX2)
+    boil_blit_glyph = boil_blit_glyph_avx2;
+#endif
+}
+
+// Boil field shared by the glyphs drawn in one character column, sized to
+// the largest of them and covering where any of them can boil into
+typedef struct {
+  int w, h;
+  size_t offset; // of its offsets in the frame's field buffer
+  BoilSpans spans;
+  int dense; // a glyph without spans is drawn in it, compute everything
+} ColumnField;
+
+// The laid out text, built once by frame_generator_prepare()
+static DrawCmd *draw_list = NULL;
+static int draw_count = 0;
+static ColumnField *columns = NULL;
+static int column_count = 0;
+static size_t column_fields_size = 0;
+static BoilSpan *column_spans = NULL;
+
+// Per frame row, the pixels glyphs can be drawn to. Frame buffers only need
+// these cleared between frames, the rest stays zero.
+typedef struct {
+  int x0, x1;
+} RowSpan;
+static RowSpan *dirty_rows = NULL;
+
+// Box and coverage of every drawn glyph, for fields any of them may use
+static int shared_w = 0, shared_h = 0;
+static BoilSpan *shared_spans_buf = NULL;
+static BoilSpans shared_spans;
+static int shared_dense = 0;
+
+// Fields of the g_boil_phases phases, sized to the shared box
+static BoilCache boil_cache;
+
+// With g_boil_reuse_fields, slots in each thread's window of fields by time
+// step, 0 when off
+static int window_slots = 0;
+
+// With g_tile_threads, the frame is split into TILE_W x TILE_H tiles drawn
+// by several threads, each tile's pixels small enough to stay in L2
+#define TILE_W 128
+#define TILE_H 64
+
+typedef struct {
+  int x0, y0, x1, y1; // frame area
+  int first, count;   // its glyphs in tile_cmds, clipped to it
+} Tile;
+
+static Tile *tiles = NULL;
+static int tile_count = 0;
+static DrawCmd *tile_cmds = NULL;
+static int *column_cmd = NULL; // a draw command of each column, -1 if none
+
+// Set up and tear down the tile threads, with the renderer below
+static int tiler_start(void);
+static void tiler_stop(void);
+
+// Lay the text out into draw_list, dropping glyphs outside the frame
+static int layout_build(GlyphCache *cache) {
+  int total = 0;
+  for (int li = 0; li < g_line_count; li++)
+    total += (int)strlen(g_lines[li]);
+  draw_list = (DrawCmd *)malloc((total ? total : 1) * sizeof(DrawCmd));
+  if (!draw_list)
+    return 0;
+
+  draw_count = 0;
+  column_count = 0;
+  int line_y = 0;
   for (int li = 0; li < g_line_count; li++) {
     const char *text = g_lines[li];
     int baseline = get_baseline_height(cache, text);
@@ -83,18 +291,6 @@ void render_frame_to_pixels(uint32_t *pixels, GlyphCache *cache, float t) {
         continue;
       }
 
-      float ft = (t + offset) * 0.3f;
-
-      int gw = g->width;
-      int gh = g->height;
-      uint8_t *tmp = (uint8_t *)malloc(gw * gh);
-      if (!tmp) {
-        cursor += g->width;
-        offset += 0.5f;
-        continue;
-      }
-      boil_frame(tmp, g->base_bitmap, gw, gh, ft, STRENGTH, FREQ);
-
       int yoff;
       if (has_descender(c))
         yoff = line_y + (baseline - g->height) + 13;
@@ -103,8 +299,22 @@ void render_frame_to_pixels(uint32_t *pixels, GlyphCache *cache, float t) {
       else
         yoff = line_y + (baseline - g->height);
 
-      blit_glyph_to_pixels(pixels, WIN_W, WIN_H, tmp, gw, gh, cursor, yoff);
-      free(tmp);
+      DrawCmd d = {.glyph = c,
+                   .column = i,
+                   .offset = offset,
+                   .w = g->width,
+                   .h = g->height,
+                   .x = cursor,
+                   .y = yoff};
+      d.x0 = cursor < 0 ? -cursor : 0;
+      d.y0 = yoff < 0 ? -yoff : 0;
+      d.x1 = WIN_W - cursor < d.w ? WIN_W - cursor : d.w;
+      d.y1 = WIN_H - yoff < d.h ? WIN_H - yoff : d.h;
+      if (d.x0 < d.x1 && d.y0 < d.y1) {
+        draw_list[draw_count++] = d;
+        if (i + 1 > column_count)
+          column_count = i + 1;
+      }
 
       cursor += g->width;
       offset += 0.5f;
@@ -112,39 +322,812 @@ void render_frame_to_pixels(uint32_t *pixels, GlyphCache *cache, float t) {
 
     line_y += 24 + g_line_gap;
   }
+
+  dirty_rows = (RowSpan *)calloc(WIN_H, sizeof(RowSpan));
+  if (!dirty_rows)
+    return 0;
+  for (int k = 0; k < draw_count; k++) {
+    const DrawCmd *d = &draw_list[k];
+    for (int y = d->y + d->y0; y < d->y + d->y1; y++) {
+      RowSpan *r = &dirty_rows[y];
+      if (r->x0 >= r->x1) {
+        r->x0 = d->x + d->x0;
+        r->x1 = d->x + d->x1;
+        continue;
+      }
+      if (d->x + d->x0 < r->x0)
+        r->x0 = d->x + d->x0;
+      if (d->x + d->x1 > r->x1)
+        r->x1 = d->x + d->x1;
+    }
+  }
+  return 1;
 }
 
-void *background_generator(void *arg) {
-  int idx = (int)(intptr_t)arg;
-  GlyphCache *cache = g_bg_cache;
-  if (!cache)
-    return NULL;
+// Restrict a draw command to the frame rect [x0, x1) x [y0, y1), returns 0 if
+// nothing of it is left
+static int draw_clip(DrawCmd *d, int x0, int y0, int x1, int y1) {
+  if (x0 - d->x > d->x0)
+    d->x0 = x0 - d->x;
+  if (y0 - d->y > d->y0)
+    d->y0 = y0 - d->y;
+  if (x1 - d->x < d->x1)
+    d->x1 = x1 - d->x;
+  if (y1 - d->y < d->y1)
+    d->y1 = y1 - d->y;
+  return d->x0 < d->x1 && d->y0 < d->y1;
+}
 
-  while (bg_keep_running) {
-    float t = frame_dt * idx++;
+// Bin the draw list into tiles, each glyph clipped to every tile it touches.
+// Tiles nothing is drawn to are left out, their pixels stay zero.
+static int tiles_build(void) {
+  int tiles_x = (WIN_W + TILE_W - 1) / TILE_W;
+  int tiles_y = (WIN_H + TILE_H - 1) / TILE_H;
+  int total = 0;
+  for (int k = 0; k < draw_count; k++) {
+    const DrawCmd *d = &draw_list[k];
+    int spans_x = (d->x + d->x1 - 1) / TILE_W - (d->x + d->x0) / TILE_W + 1;
+    int spans_y = (d->y + d->y1 - 1) / TILE_H - (d->y + d->y0) / TILE_H + 1;
+    total += spans_x * spans_y;
+  }
+  tiles = (Tile *)malloc(tiles_x * tiles_y * sizeof(Tile));
+  tile_cmds = (DrawCmd *)malloc((total ? total : 1) * sizeof(DrawCmd));
+  column_cmd = (int *)malloc((column_count ? column_count : 1) * sizeof(int));
+  if (!tiles || !tile_cmds || !column_cmd)
+    return 0;
 
-    // TODO: Find a way to optimize this as it could theoritically be a
-    // bottleneck
-    uint32_t *pixels = (uint32_t *)malloc(WIN_W * WIN_H * sizeof(uint32_t));
-    if (!pixels) {
-      usleep(5000);
-      continue;
+  tile_count = 0;
+  int n = 0;
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      Tile t = {tx * TILE_W, ty * TILE_H, (tx + 1) * TILE_W, (ty + 1) * TILE_H,
+                n, 0};
+      if (t.x1 > WIN_W)
+        t.x1 = WIN_W;
+      if (t.y1 > WIN_H)
+        t.y1 = WIN_H;
+      for (int k = 0; k < draw_count; k++) {
+        DrawCmd d = draw_list[k];
+        if (draw_clip(&d, t.x0, t.y0, t.x1, t.y1))
+          tile_cmds[n++] = d;
+      }
+      t.count = n - t.first;
+      if (t.count)
+        tiles[tile_count++] = t;
     }
+  }
 
-    render_frame_to_pixels(pixels, cache, t);
+  for (int c = 0; c < column_count; c++)
+    column_cmd[c] = -1;
+  for (int k = 0; k < draw_count; k++)
+    if (column_cmd[draw_list[k].column] < 0)
+      column_cmd[draw_list[k].column] = k;
+  return 1;
+}
 
-    pthread_mutex_lock(&bg_lock);
-    if (framesB_pixels_size == framesB_pixels_cap) {
-      framesB_pixels_cap = framesB_pixels_cap ? framesB_pixels_cap * 2 : 512;
-      framesB_pixels = (uint32_t **)realloc(
-          framesB_pixels, framesB_pixels_cap * sizeof(uint32_t *));
+// Widen spans of a w x h area to cover the visible part of a glyph
+static void spans_merge_visible(const BoilSpans *dst, const BoilSpans *src,
+                                const DrawCmd *d) {
+  BoilSpan rows[d->h], cols[d->w];
+  memset(rows, 0, sizeof(rows));
+  memset(cols, 0, sizeof(cols));
+  for (int y = d->y0; y < d->y1; y++) {
+    rows[y].lo = src->rows[y].lo > d->x0 ? src->rows[y].lo : d->x0;
+    rows[y].hi = src->rows[y].hi < d->x1 ? src->rows[y].hi : d->x1;
+  }
+  for (int x = d->x0; x < d->x1; x++) {
+    cols[x].lo = src->cols[x].lo > d->y0 ? src->cols[x].lo : d->y0;
+    cols[x].hi = src->cols[x].hi < d->y1 ? src->cols[x].hi : d->y1;
+  }
+  BoilSpans visible = {rows, cols};
+  boil_spans_merge(dst, &visible, d->w, d->h);
+}
+
+// Size the column fields and merge their coverage
+static int columns_build(GlyphCache *cache) {
+  columns = (ColumnField *)calloc(column_count ? column_count : 1,
+                                  sizeof(ColumnField));
+  if (!columns)
+    return 0;
+  for (int k = 0; k < draw_count; k++) {
+    ColumnField *col = &columns[draw_list[k].column];
+    if (draw_list[k].w > col->w)
+      col->w = draw_list[k].w;
+    if (draw_list[k].h > col->h)
+      col->h = draw_list[k].h;
+  }
+
+  size_t spans_size = 0;
+  column_fields_size = 0;
+  for (int i = 0; i < column_count; i++) {
+    columns[i].offset = column_fields_size;
+    column_fields_size += 2 * (size_t)columns[i].w * columns[i].h;
+    spans_size += (size_t)columns[i].h + columns[i].w;
+  }
+  column_spans = (BoilSpan *)calloc(spans_size ? spans_size : 1,
+                                    sizeof(BoilSpan));
+  if (!column_spans)
+    return 0;
+
+  BoilSpan *next = column_spans;
+  for (int i = 0; i < column_count; i++) {
+    columns[i].spans.rows = next;
+    columns[i].spans.cols = next + columns[i].h;
+    next += columns[i].h + columns[i].w;
+  }
+  for (int k = 0; k < draw_count; k++) {
+    const DrawCmd *d = &draw_list[k];
+    ColumnField *col = &columns[d->column];
+    const GlyphData *g = &cache->glyphs[d->glyph];
+    if (!g->boil_spans.rows)
+      col->dense = 1;
+    else
+      spans_merge_visible(&col->spans, &g->boil_spans, d);
+  }
+  return 1;
+}
+
+// Size the shared box and merge the coverage of every drawn glyph
+static int shared_build(GlyphCache *cache) {
+  for (int k = 0; k < draw_count; k++) {
+    if (draw_list[k].w > shared_w)
+      shared_w = draw_list[k].w;
+    if (draw_list[k].h > shared_h)
+      shared_h = draw_list[k].h;
+  }
+  if (!shared_w || !shared_h)
+    return 1;
+
+  shared_spans_buf =
+      (BoilSpan *)calloc(shared_h + shared_w, sizeof(BoilSpan));
+  if (!shared_spans_buf)
+    return 0;
+  shared_spans.rows = shared_spans_buf;
+  shared_spans.cols = shared_spans_buf + shared_h;
+  for (int k = 0; k < draw_count; k++) {
+    const GlyphData *g = &cache->glyphs[draw_list[k].glyph];
+    if (!g->boil_spans.rows)
+      shared_dense = 1;
+    else
+      spans_merge_visible(&shared_spans, &g->boil_spans, &draw_list[k]);
+  }
+  return 1;
+}
+
+// Phase fields covering every drawn glyph, and the pre-boiled glyphs
+static int boil_caches_build(GlyphCache *cache) {
+  int w = shared_w, h = shared_h;
+  if (!w || !h)
+    return 1;
+
+  // Any glyph can be boiled with any phase, the shared box covers them all.
+  // Glyph times advance by frame_dt * BOIL_TIME_SCALE per frame, and by a
+  // multiple of it per column.
+  if (!boil_cache_build(&boil_cache, g_boil_phases,
+                        frame_dt * BOIL_TIME_SCALE, w, h,
+                        shared_dense ? NULL : &shared_spans, BOIL_STRENGTH,
+                        BOIL_FREQ))
+    return 0;
+  printf("Boil cache: %d phases, %zu KiB\n", g_boil_phases,
+         (2 * (size_t)w * h * g_boil_phases + 1023) / 1024);
+
+  if (g_boil_glyph_cache) {
+    if (!alloc_glyph_phases(cache, g_boil_phases))
+      return 0;
+    size_t area = 0;
+    for (int c = 0; c < 128; c++)
+      if (cache->glyphs[c].boiled_phases)
+        area += (size_t)cache->glyphs[c].width * cache->glyphs[c].height;
+    printf("Glyph cache: up to %zu KiB\n",
+           (area * g_boil_phases + 1023) / 1024);
+  }
+  return 1;
+}
+
+// Size the window of fields by time step. A column's glyph time is a whole
+// number of steps after the first column's, so a frame's columns use
+// consecutive windows of steps, shifted by one step each frame.
+static void window_build(void) {
+  float step = frame_dt * BOIL_TIME_SCALE;
+  long lo = 0, hi = 0;
+  for (int k = 0; k < draw_count; k++) {
+    long n = lroundf(draw_list[k].offset * BOIL_TIME_SCALE / step);
+    if (k == 0 || n < lo)
+      lo = n;
+    if (k == 0 || n > hi)
+      hi = n;
+  }
+  window_slots = (int)(hi - lo) + 1;
+  printf("Field window: %d steps, %zu KiB per thread\n", window_slots,
+         (2 * (size_t)shared_w * shared_h * window_slots + 1023) / 1024);
+}
+
+int frame_generator_prepare(GlyphCache *cache) {
+  if (!layout_build(cache) || !columns_build(cache))
+    return 0;
+  if ((g_boil_phases || g_boil_reuse_fields) && !shared_build(cache)) {
+    fprintf(stderr, "Failed to allocate the shared boil fields\n");
+    return 1;
+  }
+  if (g_boil_phases && !boil_caches_build(cache))
+    fprintf(stderr, "Failed to allocate the boil caches\n");
+  else if (!g_boil_phases && g_boil_reuse_fields && shared_w)
+    window_build();
+  if (g_tile_threads && !tiler_start()) {
+    fprintf(stderr, "Failed to set up the tiles, rendering frames whole\n");
+    tiler_stop();
+  }
+  return 1;
+}
+
+// Frame buffers handed back after upload, clear outside dirty_rows. Only a
+// few are kept, the generator rarely gets further ahead than that between
+// two uploads.
+#define FRAME_POOL_MAX 16
+static uint32_t *frame_pool[FRAME_POOL_MAX];
+static int frame_pool_size = 0;
+static pthread_mutex_t frame_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t *frame_buffer_acquire(void) {
+  pthread_mutex_lock(&frame_pool_lock);
+  uint32_t *pixels = frame_pool_size ? frame_pool[--frame_pool_size] : NULL;
+  pthread_mutex_unlock(&frame_pool_lock);
+  if (!pixels)
+    pixels = (uint32_t *)calloc((size_t)WIN_W * WIN_H, sizeof(uint32_t));
+  return pixels;
+}
+
+void frame_buffer_release(uint32_t *pixels) {
+  pthread_mutex_lock(&frame_pool_lock);
+  if (frame_pool_size < FRAME_POOL_MAX) {
+    frame_pool[frame_pool_size++] = pixels;
+    pixels = NULL;
+  }
+  pthread_mutex_unlock(&frame_pool_lock);
+  free(pixels);
+}
+
+void frame_generator_cleanup(void) {
+  tiler_stop();
+  frame_generator_thread_cleanup();
+  boil_cache_free(&boil_cache);
+  free(shared_spans_buf);
+  shared_spans_buf = NULL;
+  shared_w = shared_h = shared_dense = 0;
+  window_slots = 0;
+  free(draw_list);
+  free(columns);
+  free(column_spans);
+  free(dirty_rows);
+  draw_list = NULL;
+  columns = NULL;
+  column_spans = NULL;
+  dirty_rows = NULL;
+  draw_count = column_count = 0;
+
+  pthread_mutex_lock(&frame_pool_lock);
+  while (frame_pool_size > 0)
+    free(frame_pool[--frame_pool_size]);
+  pthread_mutex_unlock(&frame_pool_lock);
+}
+
+// Clear what the previous frame drew into a buffer. The glyphs are composited
+// into the same lines right after, so they are cleared through the cache.
+static void clear_dirty(uint32_t *pixels) {
+  for (int y = 0; y < WIN_H; y++)
+    if (dirty_rows[y].x0 < dirty_rows[y].x1)
+      memset(pixels + y * WIN_W + dirty_rows[y].x0, 0,
+             (dirty_rows[y].x1 - dirty_rows[y].x0) * sizeof(uint32_t));
+}
+
+// Boil offsets of the frame being rendered, one field per character column.
+// A glyph's boil time only depends on its column, so all lines share them.
+// Kept per thread and grown as needed so frames don't allocate.
+static _Thread_local int8_t *col_fields = NULL;
+static _Thread_local size_t col_fields_cap = 0;
+
+// Grow a column field buffer to column_fields_size, returns 0 on failure
+static int fields_reserve(int8_t **fields, size_t *cap) {
+  if (column_fields_size <= *cap)
+    return 1;
+  int8_t *grown = (int8_t *)realloc(*fields, column_fields_size);
+  if (!grown)
+    return 0;
+  *fields = grown;
+  *cap = column_fields_size;
+  return 1;
+}
+
+// The thread's fields by time step, in the shared box. Slot n % slots holds
+// the field of step n once computed, so the columns of the following frames
+// that reach the same time reuse it.
+typedef struct {
+  int8_t *data;
+  long *step; // held by each slot, LONG_MIN if none
+  int failed;
+} FieldWindow;
+
+static _Thread_local FieldWindow window;
+
+static void window_free(void) {
+  free(window.data);
+  free(window.step);
+  memset(&window, 0, sizeof(window));
+}
+
+// Field of the time step nearest to ft from the thread's window, returns 0 if
+// the window can't be allocated
+static int window_field(BoilField *field, float ft) {
+  size_t size = 2 * (size_t)shared_w * shared_h;
+  if (!window.data) {
+    if (window.failed)
+      return 0;
+    window.data = (int8_t *)malloc(size * window_slots);
+    window.step = (long *)malloc(window_slots * sizeof(long));
+    if (!window.data || !window.step) {
+      window_free();
+      window.failed = 1;
+      fprintf(stderr, "Failed to allocate the field window\n");
+      return 0;
     }
-    framesB_pixels[framesB_pixels_size++] = pixels;
-    pthread_mutex_unlock(&bg_lock);
-    printf("Frame generated\n");
+    for (int i = 0; i < window_slots; i++)
+      window.step[i] = LONG_MIN;
+  }
+
+  float dt = frame_dt * BOIL_TIME_SCALE;
+  long n = lroundf(ft / dt);
+  int slot = (int)(n % window_slots);
+  if (slot < 0)
+    slot += window_slots;
+  int8_t *data = window.data + slot * size;
+  *field = (BoilField){data, data + (size_t)shared_w * shared_h, shared_w};
+  if (window.step[slot] != n) {
+    boil_field_compute(field, shared_w, shared_h,
+                       shared_dense ? NULL : &shared_spans, (float)n * dt,
+                       BOIL_STRENGTH, BOIL_FREQ);
+    window.step[slot] = n;
+  }
+  return 1;
+}
+
+// Boil field of a draw command at glyph time ft: the phase cache's, the field
+// window's, or its column's computed into `fields` the first time the column
+// is drawn
+static BoilField column_field(int8_t *fields, char *col_done,
+                              const DrawCmd *d, float ft) {
+  if (boil_cache.data)
+    return boil_cache_field(&boil_cache, boil_cache_phase(&boil_cache, ft));
+
+  BoilField shared;
+  if (window_slots && window_field(&shared, ft))
+    return shared;
+
+  const ColumnField *col = &columns[d->column];
+  BoilField field = {fields + col->offset,
+                     fields + col->offset + col->w * col->h, col->w};
+  if (!col_done[d->column]) {
+    boil_field_compute(&field, col->w, col->h,
+                       col->dense ? NULL : &col->spans, ft, BOIL_STRENGTH,
+                       BOIL_FREQ);
+    col_done[d->column] = 1;
+  }
+  return field;
+}
+
+// With --glyph-cache, draw a glyph from its boiled bitmap at glyph time ft.
+// Returns 0 if it has to be boiled instead.
+static int draw_cached(uint32_t *pixels, GlyphData *g, const DrawCmd *d,
+                       float ft) {
+  if (!g->boiled_phases)
+    return 0;
+  int p = boil_cache_phase(&boil_cache, ft);
+  BoilField pf = boil_cache_field(&boil_cache, p);
+  const uint8_t *boiled = get_boiled_phase(g, p, &pf);
+  if (!boiled)
+    return 0;
+  blit_glyph_to_pixels(pixels, WIN_W, boiled, d);
+  return 1;
+}
+
+// Threads rendering the tiles of a frame together with its caller, one frame
+// at a time. The column fields are computed first, then shared by the tiles.
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // a frame was started, or stop was set
+  pthread_cond_t idle; // no helper is inside a frame anymore
+  pthread_t *threads;
+  int thread_count;
+  int generation; // bumped for every frame
+  int active;     // helpers working on the current frame
+  int stop;
+
+  // The frame being rendered
+  uint32_t *pixels;
+  GlyphCache *cache;
+  float t;
+  int8_t *fields;
+  BoilField *column_fields;
+  char *col_done;
+  atomic_int next_column, columns_done, next_tile, tiles_done;
+} tiler = {.lock = PTHREAD_MUTEX_INITIALIZER,
+           .wake = PTHREAD_COND_INITIALIZER,
+           .idle = PTHREAD_COND_INITIALIZER};
+
+static pthread_mutex_t tiler_frame_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Clear what earlier frames drew into a tile and draw its glyphs
+static void tile_render(const Tile *tile) {
+  uint32_t *pixels = tiler.pixels;
+  for (int y = tile->y0; y < tile->y1; y++) {
+    int x0 = dirty_rows[y].x0 > tile->x0 ? dirty_rows[y].x0 : tile->x0;
+    int x1 = dirty_rows[y].x1 < tile->x1 ? dirty_rows[y].x1 : tile->x1;
+    if (x0 < x1)
+      memset(pixels + y * WIN_W + x0, 0, (x1 - x0) * sizeof(uint32_t));
+  }
+  for (int k = tile->first; k < tile->first + tile->count; k++) {
+    const DrawCmd *d = &tile_cmds[k];
+    GlyphData *g = &tiler.cache->glyphs[d->glyph];
+    if (!draw_cached(pixels, g, d, (tiler.t + d->offset) * BOIL_TIME_SCALE))
+      boil_blit_glyph(pixels, WIN_W, g->base_bitmap, g->pitch,
+                      &tiler.column_fields[d->column], d);
+  }
+}
+
+// Take columns, then tiles, of the current frame until none are left
+static void tiler_work(void) {
+  int c;
+  while ((c = atomic_fetch_add(&tiler.next_column, 1)) < column_count) {
+    if (column_cmd[c] >= 0) {
+      const DrawCmd *d = &draw_list[column_cmd[c]];
+      tiler.column_fields[c] =
+          column_field(tiler.fields, tiler.col_done, d,
+                       (tiler.t + d->offset) * BOIL_TIME_SCALE);
+    }
+    atomic_fetch_add(&tiler.columns_done, 1);
+  }
+  // A tile may need any column's field
+  while (atomic_load(&tiler.columns_done) < column_count)
+    sched_yield();
+
+  int i;
+  while ((i = atomic_fetch_add(&tiler.next_tile, 1)) < tile_count) {
+    tile_render(&tiles[i]);
+    atomic_fetch_add(&tiler.tiles_done, 1);
+  }
+}
+
+static void *tiler_thread(void *arg) {
+  (void)arg;
+  int seen = 0;
+  pthread_mutex_lock(&tiler.lock);
+  for (;;) {
+    while (tiler.generation == seen && !tiler.stop)
+      pthread_cond_wait(&tiler.wake, &tiler.lock);
+    if (tiler.stop)
+      break;
+    seen = tiler.generation;
+    tiler.active++;
+    pthread_mutex_unlock(&tiler.lock);
+    tiler_work();
+    pthread_mutex_lock(&tiler.lock);
+    if (!--tiler.active)
+      pthread_cond_broadcast(&tiler.idle);
+  }
+  pthread_mutex_unlock(&tiler.lock);
+  frame_generator_thread_cleanup();
+  return NULL;
+}
+
+static void render_frame_tiled(uint32_t *pixels, GlyphCache *cache, float t) {
+  pthread_mutex_lock(&tiler_frame_lock);
+  pthread_mutex_lock(&tiler.lock);
+  // Helpers still leaving the last frame would take this one's columns
+  while (tiler.active)
+    pthread_cond_wait(&tiler.idle, &tiler.lock);
+  tiler.pixels = pixels;
+  tiler.cache = cache;
+  tiler.t = t;
+  memset(tiler.col_done, 0, column_count);
+  atomic_store(&tiler.next_column, 0);
+  atomic_store(&tiler.columns_done, 0);
+  atomic_store(&tiler.next_tile, 0);
+  atomic_store(&tiler.tiles_done, 0);
+  tiler.generation++;
+  pthread_cond_broadcast(&tiler.wake);
+  pthread_mutex_unlock(&tiler.lock);
+
+  tiler_work();
+  while (atomic_load(&tiler.tiles_done) < tile_count)
+    sched_yield();
+  pthread_mutex_unlock(&tiler_frame_lock);
+}
+
+// Bin the layout into tiles and start the helpers, g_tile_threads - 1 of
+// them. Returns 0 if the tiles could not be set up.
+static int tiler_start(void) {
+  if (!tiles_build())
+    return 0;
+  tiler.fields = (int8_t *)malloc(column_fields_size ? column_fields_size : 1);
+  tiler.column_fields = (BoilField *)calloc(column_count ? column_count : 1,
+                                            sizeof(BoilField));
+  tiler.col_done = (char *)malloc(column_count ? column_count : 1);
+  tiler.threads =
+      (pthread_t *)malloc(g_tile_threads * sizeof(pthread_t));
+  if (!tiler.fields || !tiler.column_fields || !tiler.col_done ||
+      !tiler.threads)
+    return 0;
+  for (; tiler.thread_count < g_tile_threads - 1; tiler.thread_count++)
+    if (pthread_create(&tiler.threads[tiler.thread_count], NULL, tiler_thread,
+                       NULL))
+      break;
+  printf("Tiles: %d on %d threads\n", tile_count, tiler.thread_count + 1);
+  return 1;
+}
+
+static void tiler_stop(void) {
+  pthread_mutex_lock(&tiler.lock);
+  tiler.stop = 1;
+  pthread_cond_broadcast(&tiler.wake);
+  pthread_mutex_unlock(&tiler.lock);
+  for (int i = 0; i < tiler.thread_count; i++)
+    pthread_join(tiler.threads[i], NULL);
+  free(tiler.threads);
+  free(tiler.fields);
+  free(tiler.column_fields);
+  free(tiler.col_done);
+  tiler.threads = NULL;
+  tiler.fields = NULL;
+  tiler.column_fields = NULL;
+  tiler.col_done = NULL;
+  tiler.thread_count = 0;
+  tiler.stop = 0;
+
+  free(tiles);
+  free(tile_cmds);
+  free(column_cmd);
+  tiles = NULL;
+  tile_cmds = NULL;
+  column_cmd = NULL;
+  tile_count = 0;
+}
+
+// Clear what the buffer's last frame drew, then composite the display list.
+// Each column's boil field is computed once for all of its glyphs, glyphs the
+// phase caches already hold are only blitted.
+void render_frame_to_pixels(uint32_t *pixels, GlyphCache *cache, float t) {
+  if (tile_count) {
+    render_frame_tiled(pixels, cache, t);
+    return;
+  }
+
+  clear_dirty(pixels);
+  if (!fields_reserve(&col_fields, &col_fields_cap))
+    return;
+  char col_done[column_count ? column_count : 1];
+  memset(col_done, 0, sizeof(col_done));
 
-    usleep(1000);
+  for (int k = 0; k < draw_count; k++) {
+    const DrawCmd *d = &draw_list[k];
+    GlyphData *g = &cache->glyphs[d->glyph];
+    float ft = (t + d->offset) * BOIL_TIME_SCALE;
+
+    if (draw_cached(pixels, g, d, ft))
+      continue;
+
+    BoilField field = column_field(col_fields, col_done, d, ft);
+    boil_blit_glyph(pixels, WIN_W, g->base_bitmap, g->pitch, &field, d);
+  }
+}
+
+void frame_generator_thread_cleanup(void) {
+  window_free();
+  free(col_fields);
+  col_fields = NULL;
+  col_fields_cap = 0;
+}
+
+// Generator workers. Each claims the lowest frame index nobody has claimed
+// yet, so the frames the player needs next come first.
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+static atomic_int next_index;
+
+// Frames handed from the workers to the player, in frame order. Frame i goes
+// to slot i % queue_size, which its seq marks free for i by being i and full
+// with it by being i + 1. Each slot has a single writer at a time, the worker
+// of its frame or the player, so no locks are needed.
+typedef struct {
+  atomic_int seq;
+  uint32_t *pixels;
+  pthread_cond_t freed; // the player took the frame in it
+} QueueSlot;
+
+// Smallest frame queue, it grows with the worker count and g_buffer_frames
+#define FRAME_QUEUE_MIN 32
+
+static QueueSlot *queue = NULL;
+static int queue_size = 0;
+static int queue_head = 0; // next frame the player takes
+
+// Workers whose frame's slot is still full sleep on its freed condition,
+// under flow_lock, until the player takes the frame in it
+static atomic_int queue_waiters;
+static pthread_mutex_t flow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Hand frame idx to the player, once it took the frame queue_size before it.
+// Returns 0 if the generator stopped first, the caller still owns the frame
+// then.
+static int publish_frame(int idx, uint32_t *pixels) {
+  QueueSlot *slot = &queue[idx % queue_size];
+  if (atomic_load(&slot->seq) != idx) {
+    pthread_mutex_lock(&flow_lock);
+    atomic_fetch_add(&queue_waiters, 1);
+    while (atomic_load(&slot->seq) != idx && bg_keep_running)
+      pthread_cond_wait(&slot->freed, &flow_lock);
+    atomic_fetch_sub(&queue_waiters, 1);
+    pthread_mutex_unlock(&flow_lock);
+    if (atomic_load(&slot->seq) != idx)
+      return 0;
   }
+  slot->pixels = pixels;
+  atomic_store_explicit(&slot->seq, idx + 1, memory_order_release);
+  return 1;
+}
+
+uint32_t *frame_queue_pop(void) {
+  if (!queue)
+    return NULL;
+  QueueSlot *slot = &queue[queue_head % queue_size];
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue_head + 1)
+    return NULL;
+  uint32_t *pixels = slot->pixels;
+  slot->pixels = NULL;
+  // Sequentially consistent, so either a worker that is about to wait sees
+  // the slot free, or the count of waiters here includes it
+  atomic_store(&slot->seq, queue_head + queue_size);
+  queue_head++;
+  if (atomic_load(&queue_waiters)) {
+    pthread_mutex_lock(&flow_lock);
+    pthread_cond_broadcast(&slot->freed);
+    pthread_mutex_unlock(&flow_lock);
+  }
+  return pixels;
+}
+
+int frame_queue_ready(void) {
+  int n = 0;
+  while (queue && n < queue_size &&
+         atomic_load_explicit(&queue[(queue_head + n) % queue_size].seq,
+                              memory_order_acquire) == queue_head + n + 1)
+    n++;
+  return n;
+}
+
+// Flow control: workers stop claiming frames once they are g_buffer_frames
+// ahead of the one playing, and wait until the player has caught up to the
+// low mark, a quarter of that below
+static atomic_int played_index;
+static atomic_int flow_paused;
+static int buffer_low = 0;
+static pthread_cond_t flow_cond = PTHREAD_COND_INITIALIZER;
+
+// Wait while the workers are too far ahead, returns 0 if the generator stops
+static int flow_wait(void) {
+  if (atomic_load(&next_index) - atomic_load(&played_index) < g_buffer_frames &&
+      !atomic_load(&flow_paused))
+    return bg_keep_running;
+
+  pthread_mutex_lock(&flow_lock);
+  if (atomic_load(&next_index) - atomic_load(&played_index) >= g_buffer_frames)
+    atomic_store(&flow_paused, 1);
+  while (atomic_load(&flow_paused) && bg_keep_running)
+    pthread_cond_wait(&flow_cond, &flow_lock);
+  pthread_mutex_unlock(&flow_lock);
+  return bg_keep_running;
+}
 
+void generator_frame_played(void) {
+  int played = atomic_fetch_add(&played_index, 1) + 1;
+  if (!atomic_load(&flow_paused) ||
+      atomic_load(&next_index) - played >= buffer_low)
+    return;
+  pthread_mutex_lock(&flow_lock);
+  atomic_store(&flow_paused, 0);
+  pthread_cond_broadcast(&flow_cond);
+  pthread_mutex_unlock(&flow_lock);
+}
+
+static void *background_generator(void *arg) {
+  (void)arg;
+  GlyphCache *cache = g_bg_cache;
+
+  while (flow_wait()) {
+    int idx = atomic_fetch_add(&next_index, 1);
+
+    // The index is claimed, the frame can't be skipped
+    uint32_t *pixels;
+    while (!(pixels = frame_buffer_acquire()) && bg_keep_running)
+      usleep(5000);
+    if (!pixels)
+      break;
+
+    render_frame_to_pixels(pixels, cache, frame_dt * idx);
+    if (!publish_frame(idx, pixels)) {
+      frame_buffer_release(pixels);
+      break;
+    }
+    printf("Frame generated\n");
+  }
+
+  frame_generator_thread_cleanup();
   return NULL;
 }
+
+int generator_start(GlyphCache *cache, int count, int first) {
+  if (count <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cpus > 0 ? (int)cpus : 1;
+  }
+  workers = (pthread_t *)malloc(count * sizeof(pthread_t));
+  // Room for every worker to finish a frame or two ahead of the player, and
+  // for all the frames flow control lets them get ahead
+  queue_size = 2 * count > FRAME_QUEUE_MIN ? 2 * count : FRAME_QUEUE_MIN;
+  if (queue_size < g_buffer_frames)
+    queue_size = g_buffer_frames;
+  queue = (QueueSlot *)calloc(queue_size, sizeof(QueueSlot));
+  if (!workers || !queue) {
+    free(workers);
+    free(queue);
+    workers = NULL;
+    queue = NULL;
+    queue_size = 0;
+    return 0;
+  }
+  for (int idx = first; idx < first + queue_size; idx++) {
+    atomic_init(&queue[idx % queue_size].seq, idx);
+    pthread_cond_init(&queue[idx % queue_size].freed, NULL);
+  }
+  queue_head = first;
+
+  g_bg_cache = cache;
+  bg_keep_running = 1;
+  atomic_store(&next_index, first);
+  atomic_store(&played_index, first);
+  atomic_store(&flow_paused, 0);
+  buffer_low = g_buffer_frames - g_buffer_frames / 4;
+  for (worker_count = 0; worker_count < count; worker_count++) {
+    if (pthread_create(&workers[worker_count], NULL, background_generator,
+                       NULL)) {
+      fprintf(stderr, "Failed to start generator worker %d\n", worker_count);
+      break;
+    }
+  }
+  if (!worker_count) {
+    generator_stop();
+    return 0;
+  }
+  printf("Generating frames on %d workers\n", worker_count);
+  return 1;
+}
+
+void generator_stop(void) {
+  pthread_mutex_lock(&flow_lock);
+  bg_keep_running = 0;
+  pthread_cond_broadcast(&flow_cond);
+  for (int i = 0; i < queue_size; i++)
+    pthread_cond_broadcast(&queue[i].freed);
+  pthread_mutex_unlock(&flow_lock);
+  for (int i = 0; i < worker_count; i++)
+    pthread_join(workers[i], NULL);
+
+  for (int i = 0; i < queue_size; i++) {
+    if (queue[i].pixels)
+      frame_buffer_release(queue[i].pixels);
+    pthread_cond_destroy(&queue[i].freed);
+  }
+  free(queue);
+  free(workers);
+  queue = NULL;
+  workers = NULL;
+  queue_size = worker_count = 0;
+}
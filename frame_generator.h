@@ -5,6 +5,7 @@
 
 #include "glyph_cache.h"
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 // Frame generation constants
@@ -12,6 +13,30 @@ extern const int FPS;
 extern const float frame_dt;
 extern const int PREG;
 
+// Boil effect parameters
+extern const float BOIL_STRENGTH;
+extern const float BOIL_FREQ;
+
+// Boil time phases whose fields are computed up front, the boil then loops
+// every g_boil_phases frames. 0 computes the fields every frame.
+extern int g_boil_phases;
+
+// Also keep every glyph's boiled bitmap of each phase, so frames past the
+// first loop are only blits
+extern int g_boil_glyph_cache;
+
+// Share the boil fields of each time step between the frames and columns
+// that reach it, in a window per thread. No effect with g_boil_phases.
+extern int g_boil_reuse_fields;
+
+// Render each frame in tiles on this many threads, the caller being one of
+// them. 0 renders frames whole on the calling thread.
+extern int g_tile_threads;
+
+// How many frames the generator may get ahead of the one playing, at least
+// PREG since the preroll is generated before anything plays
+extern int g_buffer_frames;
+
 // Window dimensions
 extern int WIN_W;
 extern int WIN_H;
@@ -22,21 +47,55 @@ extern int g_line_count;
 extern int g_line_gap;
 
 // Background thread control
-extern int bg_keep_running;
-extern pthread_mutex_t bg_lock;
-
-// Frame buffers (raw pixels from background thread)
-extern uint32_t **framesB_pixels;
-extern int framesB_pixels_size;
-extern int framesB_pixels_cap;
+extern atomic_int bg_keep_running;
 
 // Global cache pointer for background thread
 extern GlyphCache *g_bg_cache;
 
-// Render a full frame into pixel buffer
+// Pick the frame kernels for the CPU level from cpu_init()
+void frame_generator_init(void);
+
+// Lay the text out for the loaded glyphs and set up what the renderer
+// precomputes, call once the noise is prepared and before rendering frames.
+// Returns 0 if the layout could not be allocated, the optional caches are
+// skipped with a warning instead.
+int frame_generator_prepare(GlyphCache *cache);
+
+// Release what frame_generator_prepare() set up
+void frame_generator_cleanup(void);
+
+// Get a zeroed WIN_W x WIN_H frame buffer, or a recycled one that only has
+// rendered text left in it. NULL if out of memory.
+uint32_t *frame_buffer_acquire(void);
+
+// Recycle a frame buffer once its pixels have been uploaded
+void frame_buffer_release(uint32_t *pixels);
+
+// Render a full frame into a buffer from frame_buffer_acquire(). Only the
+// pixels previous frames may have drawn to are cleared first.
 void render_frame_to_pixels(uint32_t *pixels, GlyphCache *cache, float t);
 
-// Background thread function
-void *background_generator(void *arg);
+// Release the calling thread's rendering state, before it exits
+void frame_generator_thread_cleanup(void);
+
+// Start `count` generator workers, 0 for one per CPU, rendering frames from
+// index `first` on. Returns 0 if none could be started.
+int generator_start(GlyphCache *cache, int count, int first);
+
+// Tell the workers a frame was presented, waking them once the player is
+// back under the low mark
+void generator_frame_played(void);
+
+// Take the next frame from the workers, in index order. NULL if it isn't
+// ready yet. Only the player thread may call this; release the frame with
+// frame_buffer_release() once uploaded.
+uint32_t *frame_queue_pop(void);
+
+// How many frames frame_queue_pop() can take right now. Only the player
+// thread may call this.
+int frame_queue_ready(void);
+
+// Stop and join the generator workers, dropping frames not yet taken
+void generator_stop(void);
 
 #endif // FRAME_GENERATOR_H
@@ -1,8 +1,11 @@
 // glyph_cache.c - Glyph caching implementation
 
 #include "glyph_cache.h"
+#include "frame_generator.h"
 #include "voronoi.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int has_descender(int ascii) {
   if (ascii == 'g' || ascii == 'j' || ascii == 'p' || ascii == 'q' ||
@@ -32,10 +35,38 @@ void load_glyph(GlyphCache *cache, SDL_Renderer *renderer, int ascii) {
   uint8_t *glyph = stbtt_GetCodepointBitmap(
       &cache->font, cache->scale, cache->scale, ascii, &gw, &gh, 0, 0);
 
+  // Copy it into a zero apron the boil can't reach past, so the remap needs
+  // no bounds checks
+  int apron = boil_apron(BOIL_STRENGTH);
+  int pitch = (gw + 2 * apron + 63) & ~63;
+  size_t size = (size_t)pitch * (gh + 2 * apron) + 3;
+  uint8_t *alloc = glyph ? calloc(size + 63, 1) : NULL;
+  if (!alloc) {
+    fprintf(stderr, "Failed to load glyph %d\n", ascii);
+    stbtt_FreeBitmap(glyph, NULL);
+    cache->glyphs[ascii].loaded = 1;
+    return;
+  }
+  uint8_t *padded = (uint8_t *)(((uintptr_t)alloc + 63) & ~(uintptr_t)63);
+  uint8_t *base = padded + apron * pitch + apron;
+  for (int y = 0; y < gh; y++)
+    memcpy(base + y * pitch, glyph + y * gw, gw);
+
   cache->glyphs[ascii].width = gw;
   cache->glyphs[ascii].height = gh;
-  cache->glyphs[ascii].base_bitmap = glyph;
+  cache->glyphs[ascii].base_bitmap = base;
+  cache->glyphs[ascii].pitch = pitch;
+  cache->glyphs[ascii].bitmap_alloc = alloc;
   cache->glyphs[ascii].boiled_bitmap = malloc(gw * gh);
+
+  BoilSpan *spans = malloc((gh + gw) * sizeof(BoilSpan));
+  if (spans) {
+    BoilSpans *s = &cache->glyphs[ascii].boil_spans;
+    s->rows = spans;
+    s->cols = spans + gh;
+    boil_spans_build(s, glyph, gw, gh, BOIL_STRENGTH);
+  }
+  stbtt_FreeBitmap(glyph, NULL);
   cache->glyphs[ascii].texture = SDL_CreateTexture(
       renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, gw, gh);
   SDL_SetTextureBlendMode(cache->glyphs[ascii].texture, SDL_BLENDMODE_BLEND);
@@ -54,6 +85,57 @@ int get_baseline_height(GlyphCache *cache, const char *text) {
   return maxh;
 }
 
+int get_max_glyph_extent(GlyphCache *cache) {
+  int maxe = 0;
+  for (int c = 0; c < 128; c++) {
+    GlyphData *g = &cache->glyphs[c];
+    if (!g->loaded)
+      continue;
+    if (g->width > maxe)
+      maxe = g->width;
+    if (g->height > maxe)
+      maxe = g->height;
+  }
+  return maxe;
+}
+
+int alloc_glyph_phases(GlyphCache *cache, int phases) {
+  cache->phases = phases;
+  for (int c = 0; c < 128; c++) {
+    GlyphData *g = &cache->glyphs[c];
+    if (!g->loaded || !g->base_bitmap)
+      continue;
+    g->boiled_phases = calloc(phases, sizeof(*g->boiled_phases));
+    if (!g->boiled_phases)
+      return 0;
+  }
+  return 1;
+}
+
+const uint8_t *get_boiled_phase(GlyphData *g, int phase,
+                                const BoilField *field) {
+  uint8_t *boiled = atomic_load_explicit(&g->boiled_phases[phase],
+                                         memory_order_acquire);
+  if (boiled)
+    return boiled;
+
+  boiled = malloc(g->width * g->height);
+  if (!boiled)
+    return NULL;
+  boil_field_apply(boiled, g->base_bitmap, g->pitch, g->width, g->height,
+                   field);
+
+  // Another thread may have boiled it meanwhile, keep whichever came first
+  uint8_t *expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(
+          &g->boiled_phases[phase], &expected, boiled, memory_order_acq_rel,
+          memory_order_acquire)) {
+    free(boiled);
+    return expected;
+  }
+  return boiled;
+}
+
 void render_text(SDL_Renderer *renderer, GlyphCache *cache, const char *text,
                  int x, int y, float time) {
   int cursor = x;
@@ -74,7 +156,8 @@ void render_text(SDL_Renderer *renderer, GlyphCache *cache, const char *text,
     }
 
     float t = (time + offset) * 0.3f;
-    boil_frame(g->boiled_bitmap, g->base_bitmap, g->width, g->height, t,
+    boil_frame(g->boiled_bitmap, g->base_bitmap, g->pitch, g->width,
+               g->height, g->boil_spans.rows ? &g->boil_spans : NULL, t,
                STRENGTH, FREQ);
 
     uint32_t *pixels;
@@ -107,10 +190,15 @@ void render_text(SDL_Renderer *renderer, GlyphCache *cache, const char *text,
 void cleanup_glyph_cache(GlyphCache *cache) {
   for (int i = 0; i < 128; i++) {
     if (cache->glyphs[i].loaded) {
-      if (cache->glyphs[i].base_bitmap)
-        stbtt_FreeBitmap(cache->glyphs[i].base_bitmap, NULL);
+      free(cache->glyphs[i].bitmap_alloc);
       if (cache->glyphs[i].boiled_bitmap)
         free(cache->glyphs[i].boiled_bitmap);
+      free(cache->glyphs[i].boil_spans.rows);
+      if (cache->glyphs[i].boiled_phases) {
+        for (int p = 0; p < cache->phases; p++)
+          free(cache->glyphs[i].boiled_phases[p]);
+        free(cache->glyphs[i].boiled_phases);
+      }
       if (cache->glyphs[i].texture)
         SDL_DestroyTexture(cache->glyphs[i].texture);
     }
@@ -4,13 +4,23 @@
 #define GLYPH_CACHE_H
 
 #include "stb_truetype.h"
+#include "voronoi.h"
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 typedef struct {
+  // The glyph's top-left pixel inside a zero apron of boil_apron() pixels.
+  // Rows are `pitch` bytes apart, the apron's rows start 64-byte aligned.
   uint8_t *base_bitmap;
+  int pitch;
+  void *bitmap_alloc; // base_bitmap's allocation
   uint8_t *boiled_bitmap;
   SDL_Texture *texture;
+  // Where the boil can put ink, the rest of the box is skipped
+  BoilSpans boil_spans;
+  // Boiled bitmap of each boil phase, NULL until first drawn
+  _Atomic(uint8_t *) *boiled_phases;
   int width;
   int height;
   int loaded;
@@ -20,6 +30,7 @@ typedef struct {
   GlyphData glyphs[128];
   stbtt_fontinfo font;
   float scale;
+  int phases;
 } GlyphCache;
 
 // Check if character has a descender
@@ -31,6 +42,18 @@ void load_glyph(GlyphCache *cache, SDL_Renderer *renderer, int ascii);
 // Get baseline height for text
 int get_baseline_height(GlyphCache *cache, const char *text);
 
+// Get the largest width or height of any loaded glyph
+int get_max_glyph_extent(GlyphCache *cache);
+
+// Give every loaded glyph room for the boiled bitmaps of `phases` boil
+// phases, returns 0 if it could not be allocated
+int alloc_glyph_phases(GlyphCache *cache, int phases);
+
+// Boiled bitmap of a phase, remapped through that phase's field the first
+// time. Safe to call from several threads, NULL if out of memory.
+const uint8_t *get_boiled_phase(GlyphData *g, int phase,
+                                const BoilField *field);
+
 // Render text directly to SDL renderer (original method)
 void render_text(SDL_Renderer *renderer, GlyphCache *cache, const char *text,
                  int x, int y, float time);
@@ -1,21 +1,205 @@
 // main.c - Main program entry point
 
+#include "cpu.h"
 #include "frame_generator.h"
 #include "glyph_cache.h"
+#include "voronoi.h"
 #include <SDL2/SDL.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
 
+// Longest --buffer, each frame it holds takes WIN_W * WIN_H * 4 bytes
+#define BUFFER_MAX (10 * 144)
+
+static void usage(FILE *out, const char *prog) {
+  fprintf(out,
+          "Usage: %s [options] [font]\n"
+          "\n"
+          "Renders text with a hand-drawn \"line boil\" jitter at %d FPS.\n"
+          "A pool of worker threads (--workers) renders the first %d frames\n"
+          "off-screen, then keeps rendering new ones while they play.\n"
+          "\n"
+          "Arguments:\n"
+          "  font        font file to render with (default: font.otf)\n"
+          "\n"
+          "Options:\n"
+          "  --step N    evaluate the boil noise every N pixels and interpolate\n"
+          "              in between (default: 1, every pixel)\n"
+          "  --noise NAME\n"
+          "              noise driving the boil (default: f1), see below\n"
+          "  --single-field\n"
+          "              displace both axes from one noise field, halving the\n"
+          "              noise work for a slightly more regular boil\n"
+          "  --phases K  precompute the boil of K frames and loop it, trading\n"
+          "              memory for no noise work per frame (default: off)\n"
+          "  --glyph-cache\n"
+          "              also keep every glyph boiled at each phase, so frames\n"
+          "              are only blits (--phases defaults to %d)\n"
+          "  --reuse-fields\n"
+          "              compute the boil of each time step once and share it\n"
+          "              with the following frames that reach it\n"
+          "  --workers N render frames on N threads (default: one per CPU)\n"
+          "  --tiles N   split each frame into tiles rendered on N threads, for\n"
+          "              lower latency per frame (--workers defaults to 1)\n"
+          "  --buffer N  generate at most N frames ahead of playback, then wait\n"
+          "              until it is a quarter of that closer (default: %d, at\n"
+          "              most %d)\n"
+          "  --isa NAME  force the scalar, sse2, avx2 or avx512 kernels instead\n"
+          "              of the best ones for this CPU (also: LINEBOIL_ISA)\n"
+          "  -h, --help  show this message and exit\n"
+          "\n"
+          "Noises:\n",
+          prog, FPS, PREG, PREG, PREG, BUFFER_MAX);
+  for (int i = 0; i < noise_backend_count; i++)
+    fprintf(out, "  %-10s  %s\n", noise_backends[i].name,
+            noise_backends[i].description);
+}
+
+// Parse a positive integer option value, returns 0 when it is invalid
+static int parse_int_option(const char *name, const char *value, int max) {
+  char *end;
+  long v = value ? strtol(value, &end, 10) : 0;
+  if (!value || *end != '\0' || v < 1 || v > max) {
+    fprintf(stderr, "Invalid value for %s, expected 1-%d\n", name, max);
+    return 0;
+  }
+  return (int)v;
+}
+
+// Textures between the frame queue and the screen: the frame last presented,
+// which the renderer may still be reading from, and two waiting to play
+#define TEXTURE_RING 3
+
+// Streaming textures frames are uploaded into and recycled once they have
+// played. `count` frames wait to play, from `head` on, and the texture before
+// `head` is the one last presented.
+typedef struct {
+  SDL_Texture **textures;
+  int size;
+  int head;
+  int count;
+} TextureRing;
+
+static void ring_destroy(TextureRing *ring) {
+  for (int i = 0; i < ring->size; i++)
+    if (ring->textures[i])
+      SDL_DestroyTexture(ring->textures[i]);
+  free(ring->textures);
+  ring->textures = NULL;
+  ring->size = ring->head = ring->count = 0;
+}
+
+// Create `size` textures, returns 0 on failure
+static int ring_create(TextureRing *ring, SDL_Renderer *renderer, int size) {
+  ring->textures = (SDL_Texture **)calloc(size, sizeof(SDL_Texture *));
+  if (!ring->textures)
+    return 0;
+  ring->size = size;
+  for (int i = 0; i < size; i++) {
+    ring->textures[i] =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                          SDL_TEXTUREACCESS_STREAMING, WIN_W, WIN_H);
+    if (!ring->textures[i]) {
+      ring_destroy(ring);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Upload the frames the workers have ready into the free textures, leaving the
+// one last presented alone until the next frame is
+static void ring_fill(TextureRing *ring) {
+  uint32_t *pixels;
+  while (ring->count < ring->size - 1 && (pixels = frame_queue_pop())) {
+    SDL_Texture *tex = ring->textures[(ring->head + ring->count) % ring->size];
+    SDL_UpdateTexture(tex, NULL, pixels, WIN_W * sizeof(uint32_t));
+    frame_buffer_release(pixels);
+    ring->count++;
+  }
+}
+
 int main(int argc, char *argv[]) {
-  // TODO: Implement a usage or help message with an explanation of what the
-  // program does and its argumants.
   const char *fontfile = "font.otf";
-  if (argc >= 2)
-    fontfile = argv[1];
+  const char *isa = getenv("LINEBOIL_ISA");
+  int workers = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      usage(stdout, argv[0]);
+      return 0;
+    } else if (!strcmp(argv[i], "--step")) {
+      g_boil_step = parse_int_option(argv[i], argv[i + 1], 32);
+      if (!g_boil_step)
+        return 1;
+      i++;
+    } else if (!strcmp(argv[i], "--noise")) {
+      g_noise = argv[i + 1] ? noise_backend_find(argv[i + 1]) : NULL;
+      if (!g_noise) {
+        fprintf(stderr, "Unknown noise '%s'\n\n",
+                argv[i + 1] ? argv[i + 1] : "");
+        usage(stderr, argv[0]);
+        return 1;
+      }
+      i++;
+    } else if (!strcmp(argv[i], "--single-field")) {
+      g_boil_single_field = 1;
+    } else if (!strcmp(argv[i], "--phases")) {
+      g_boil_phases = parse_int_option(argv[i], argv[i + 1], 4096);
+      if (!g_boil_phases)
+        return 1;
+      i++;
+    } else if (!strcmp(argv[i], "--glyph-cache")) {
+      g_boil_glyph_cache = 1;
+    } else if (!strcmp(argv[i], "--reuse-fields")) {
+      g_boil_reuse_fields = 1;
+    } else if (!strcmp(argv[i], "--workers")) {
+      workers = parse_int_option(argv[i], argv[i + 1], 256);
+      if (!workers)
+        return 1;
+      i++;
+    } else if (!strcmp(argv[i], "--tiles")) {
+      g_tile_threads = parse_int_option(argv[i], argv[i + 1], 256);
+      if (!g_tile_threads)
+        return 1;
+      i++;
+    } else if (!strcmp(argv[i], "--buffer")) {
+      g_buffer_frames = parse_int_option(argv[i], argv[i + 1], BUFFER_MAX);
+      if (!g_buffer_frames)
+        return 1;
+      if (g_buffer_frames < PREG) {
+        fprintf(stderr, "--buffer must be at least %d, the preroll\n", PREG);
+        return 1;
+      }
+      i++;
+    } else if (!strcmp(argv[i], "--isa")) {
+      if (!argv[i + 1]) {
+        fprintf(stderr, "Missing value for --isa\n");
+        return 1;
+      }
+      isa = argv[++i];
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option '%s'\n\n", argv[i]);
+      usage(stderr, argv[0]);
+      return 1;
+    } else {
+      fontfile = argv[i];
+    }
+  }
+
+  if (g_boil_glyph_cache && !g_boil_phases)
+    g_boil_phases = PREG;
+  // Tiles already spread each frame over the CPUs
+  if (g_tile_threads && !workers)
+    workers = 1;
+
+  if (!cpu_init(isa))
+    return 1;
+  printf("Using %s kernels\n", cpu_level_name(cpu_level()));
 
   // Load font data
   FILE *fp = fopen(fontfile, "rb");
@@ -63,29 +247,63 @@ int main(int argc, char *argv[]) {
   }
   cache.scale = stbtt_ScaleForPixelHeight(&cache.font, 64.0f);
 
+  voronoi_init();
+  frame_generator_init();
+
   // Load glyphs
   // TODO: Optimize this loop
   for (int i = 0; i < g_line_count; i++)
     for (int j = 0; g_lines[i][j]; j++)
       load_glyph(&cache, renderer, (unsigned char)g_lines[i][j]);
 
-  SDL_Event ev;
-  int running = 1;
-
-  SDL_Texture **framesA = (SDL_Texture **)malloc(PREG * sizeof(SDL_Texture *));
-  if (!framesA) {
-    fprintf(stderr, "Alloc framesA failed\n");
+  if (g_noise->prepare &&
+      !g_noise->prepare(get_max_glyph_extent(&cache) * BOIL_FREQ)) {
+    fprintf(stderr, "Failed to prepare %s noise, using %s instead\n",
+            g_noise->name, noise_backends[0].name);
+    g_noise = &noise_backends[0];
+  }
+  if (!frame_generator_prepare(&cache)) {
+    fprintf(stderr, "Failed to lay out the text\n");
+    frame_generator_cleanup();
+    if (g_noise->release)
+      g_noise->release();
+    cleanup_glyph_cache(&cache);
+    free(ttf_data);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
     SDL_Quit();
     return 1;
   }
 
+  SDL_Event ev;
+  int running = 1;
+  int status = 0;
+
+  // Frames wait to play in the generator's queue, the textures only need to
+  // cover the one on screen and the next uploads
+  TextureRing ring = {0};
+  if (!ring_create(&ring, renderer, TEXTURE_RING)) {
+    fprintf(stderr, "Failed create texture: %s\n", SDL_GetError());
+    running = 0;
+    status = 1;
+  }
+
   // Show black screen while pre-rendering
   SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
   SDL_RenderClear(renderer);
   SDL_RenderPresent(renderer);
 
-  // Pre-generate frames
-  for (int i = 0; i < PREG && running; i++) {
+  // Start the generator workers, the first PREG frames they publish are the
+  // preroll
+  if (running && !generator_start(&cache, workers, 0)) {
+    fprintf(stderr, "Failed to start the frame generator\n");
+    running = 0;
+    status = 1;
+  }
+
+  // Pre-generate frames, they stay in the queue until they play
+  int pregenerated = 0;
+  while (running && pregenerated < PREG) {
     while (SDL_PollEvent(&ev)) {
       if (ev.type == SDL_QUIT) {
         running = 0;
@@ -95,85 +313,23 @@ int main(int argc, char *argv[]) {
     if (!running)
       break;
 
-    uint32_t *pixels = (uint32_t *)malloc(WIN_W * WIN_H * sizeof(uint32_t));
-    if (!pixels) {
-      fprintf(stderr, "Failed alloc pixels for pregen frame %d\n", i);
-      running = 0;
-      break;
-    }
-    render_frame_to_pixels(pixels, &cache, frame_dt * i);
-
-    SDL_Texture *tex =
-        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
-                          SDL_TEXTUREACCESS_STATIC, WIN_W, WIN_H);
-    if (!tex) {
-      fprintf(stderr, "Failed create texture: %s\n", SDL_GetError());
-      free(pixels);
-      running = 0;
-      break;
-    }
-    SDL_UpdateTexture(tex, NULL, pixels, WIN_W * sizeof(uint32_t));
-
-    framesA[i] = tex;
-    free(pixels);
-
-    printf("Frame pre-generated\n");
-    SDL_Delay(1);
+    int ready = frame_queue_ready();
+    if (ready > PREG)
+      ready = PREG;
+    for (; pregenerated < ready; pregenerated++)
+      printf("Frame pre-generated\n");
+    if (pregenerated < PREG)
+      SDL_Delay(1);
   }
 
-  if (!running) {
-    for (int k = 0; k < PREG; k++)
-      if (framesA[k])
-        SDL_DestroyTexture(framesA[k]);
-    free(framesA);
-    cleanup_glyph_cache(&cache);
-    free(ttf_data);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return 0;
-  }
-
-  // Start background generator
-  g_bg_cache = &cache;
-  bg_keep_running = 1;
-  pthread_t bg_thread;
-  pthread_create(&bg_thread, NULL, background_generator,
-                 (void *)(intptr_t)PREG);
-
-  SDL_Texture **framesB_textures = NULL;
-  int framesB_textures_size = 0;
-  int framesB_textures_cap = 0;
-
   const Uint32 framems = 1000 / FPS;
 
-  // Play pre-generated frames
-  for (int i = 0; i < PREG && running; i++) {
+  // Play frames as the workers produce them
+  while (running) {
     Uint32 frame_start = SDL_GetTicks();
 
-    // Convert background-produced pixel buffers to textures
-    // TODO: Optimize this
-    pthread_mutex_lock(&bg_lock);
-    while (framesB_pixels_size > 0) {
-      uint32_t *pix = framesB_pixels[--framesB_pixels_size];
-      if (framesB_textures_size == framesB_textures_cap) {
-        framesB_textures_cap =
-            framesB_textures_cap ? framesB_textures_cap * 2 : 256;
-        framesB_textures = (SDL_Texture **)realloc(
-            framesB_textures, framesB_textures_cap * sizeof(SDL_Texture *));
-      }
-      SDL_Texture *t =
-          SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
-                            SDL_TEXTUREACCESS_STATIC, WIN_W, WIN_H);
-      if (!t) {
-        free(pix);
-      } else {
-        SDL_UpdateTexture(t, NULL, pix, WIN_W * sizeof(uint32_t));
-        framesB_textures[framesB_textures_size++] = t;
-        free(pix);
-      }
-    }
-    pthread_mutex_unlock(&bg_lock);
+    // Upload frames into the textures played since the last one
+    ring_fill(&ring);
 
     while (SDL_PollEvent(&ev)) {
       if (ev.type == SDL_QUIT)
@@ -182,63 +338,19 @@ int main(int argc, char *argv[]) {
     if (!running)
       break;
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, framesA[i], NULL, NULL);
-    SDL_RenderPresent(renderer);
-
-    Uint32 elapsed = SDL_GetTicks() - frame_start;
-    if (elapsed < framems)
-      SDL_Delay(framems - elapsed);
-  }
-
-  // Play background-generated frames
-  int bidx = 0;
-  while (running) {
-    Uint32 frame_start = SDL_GetTicks();
-
-    pthread_mutex_lock(&bg_lock);
-    while (framesB_pixels_size > 0) {
-      uint32_t *pix = framesB_pixels[--framesB_pixels_size];
-      if (framesB_textures_size == framesB_textures_cap) {
-        framesB_textures_cap =
-            framesB_textures_cap ? framesB_textures_cap * 2 : 256;
-        framesB_textures = (SDL_Texture **)realloc(
-            framesB_textures, framesB_textures_cap * sizeof(SDL_Texture *));
-      }
-      SDL_Texture *t =
-          SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
-                            SDL_TEXTUREACCESS_STATIC, WIN_W, WIN_H);
-      if (!t) {
-        free(pix);
-      } else {
-        SDL_UpdateTexture(t, NULL, pix, WIN_W * sizeof(uint32_t));
-        framesB_textures[framesB_textures_size++] = t;
-        free(pix);
-      }
-    }
-    pthread_mutex_unlock(&bg_lock);
-
-    if (bidx < framesB_textures_size) {
-      while (SDL_PollEvent(&ev)) {
-        if (ev.type == SDL_QUIT)
-          running = 0;
-      }
-      if (!running)
-        break;
-
+    if (ring.count) {
       SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
       SDL_RenderClear(renderer);
-      SDL_RenderCopy(renderer, framesB_textures[bidx], NULL, NULL);
+      SDL_RenderCopy(renderer, ring.textures[ring.head], NULL, NULL);
       SDL_RenderPresent(renderer);
-      bidx++;
+      generator_frame_played();
+
+      // Presented, the texture takes a new frame once the next one is
+      ring.head = (ring.head + 1) % ring.size;
+      ring.count--;
     } else {
       if (!bg_keep_running)
         break;
-      while (SDL_PollEvent(&ev)) {
-        if (ev.type == SDL_QUIT)
-          running = 0;
-      }
       SDL_Delay(5);
     }
 
@@ -248,33 +360,17 @@ int main(int argc, char *argv[]) {
   }
 
   // Cleanup
-  bg_keep_running = 0;
-  pthread_join(bg_thread, NULL);
-
-  for (int i = 0; i < PREG; i++)
-    if (framesA[i])
-      SDL_DestroyTexture(framesA[i]);
-  free(framesA);
-
-  for (int i = 0; i < framesB_textures_size; i++)
-    if (framesB_textures[i])
-      SDL_DestroyTexture(framesB_textures[i]);
-  free(framesB_textures);
-
-  pthread_mutex_lock(&bg_lock);
-  for (int i = 0; i < framesB_pixels_size; i++) {
-    free(framesB_pixels[i]);
-  }
-  free(framesB_pixels);
-  framesB_pixels = NULL;
-  framesB_pixels_size = framesB_pixels_cap = 0;
-  pthread_mutex_unlock(&bg_lock);
+  generator_stop();
+  ring_destroy(&ring);
 
+  frame_generator_cleanup();
+  if (g_noise->release)
+    g_noise->release();
   cleanup_glyph_cache(&cache);
   free(ttf_data);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
 
-  return 0;
+  return status;
 }
@@ -1,15 +1,151 @@
-// voronoi.h - Voronoi noise functions
+// voronoi.h - Voronoi and other boil noise functions
 
 #ifndef VORONOI_H
 #define VORONOI_H
 
 #include <stdint.h>
 
+// Build the feature point lattice and pick the kernels for the CPU level from
+// cpu_init(), call once before any noise is evaluated
+void voronoi_init(void);
+
 // Generate Voronoi noise at given coordinates and time
 float voronoi(float x, float y, float t);
 
-// Apply boiling effect to a frame
-void boil_frame(uint8_t *dst, uint8_t *src, int w, int h, float t,
-                float strength, float freq);
+// Evaluate voronoi() at n points along a line, sample i is taken at
+// (x + i * dx, y + i * dy). Vectorized, with the time terms computed once.
+void voronoi_row(float *out, int n, float x, float y, float dx, float dy,
+                 float t);
+
+// Precompute the static F1 distance field over [0, extent] noise units (plus
+// the time shift), returns 0 if it could not be allocated
+int voronoi_atlas_build(float extent);
+
+// Release the distance atlas
+void voronoi_atlas_free(void);
+
+// Same as voronoi_row(), bilinearly sampled from the distance atlas. Rows
+// leaving the atlas are evaluated exactly.
+void voronoi_atlas_row(float *out, int n, float x, float y, float dx, float dy,
+                       float t);
+
+// A noise the boil can be driven by. All of them take time-shifted sample
+// positions like voronoi_row() and return values in about [0, 1.5).
+typedef struct {
+  const char *name;
+  const char *description;
+  // Bounds of the values, they limit how far the boil offsets can reach
+  float min_value;
+  float max_value;
+  // Evaluate n samples along a line, like voronoi_row()
+  void (*row)(float *out, int n, float x, float y, float dx, float dy,
+              float t);
+  // Fixed-point evaluation used instead of row when set: positions in Q16.16
+  // noise units, values in Q8.8
+  void (*row_fixed)(int32_t *out, int n, int32_t x, int32_t y, int32_t dx,
+                    int32_t dy, float t);
+  // Optional setup for glyphs spanning up to `extent` noise units, returns 0
+  // on failure, and its cleanup
+  int (*prepare)(float extent);
+  void (*release)(void);
+} NoiseBackend;
+
+extern const NoiseBackend noise_backends[];
+extern const int noise_backend_count;
+
+// Backend used by the boil, f1 by default
+extern const NoiseBackend *g_noise;
+
+// Look up a backend by name, NULL if there is none
+const NoiseBackend *noise_backend_find(const char *name);
+
+// Noise sampling step in pixels for boil_frame(), 1 evaluates every pixel,
+// larger values evaluate a coarse grid and interpolate between its points
+extern int g_boil_step;
+
+// Displace both axes from one noise field (y reads it transposed) instead of
+// a second field at a different time, halving the noise work
+extern int g_boil_single_field;
+
+// Integer source offsets of a boil, pixel (x, y) of the boiled glyph samples
+// pixel (x + dx, y + dy) of the base glyph
+typedef struct {
+  int8_t *dx;
+  int8_t *dy;
+  int stride;
+} BoilField;
+
+// A half-open range [lo, hi), empty when lo >= hi
+typedef struct {
+  int16_t lo;
+  int16_t hi;
+} BoilSpan;
+
+// Where a boil can produce ink: the glyph's inked pixels dilated by the
+// largest offsets. Row y is covered over x in rows[y], column x over y in
+// cols[x]. Everything outside boils to zero, so no noise is needed there.
+// All-zero spans cover nothing.
+typedef struct {
+  BoilSpan *rows;
+  BoilSpan *cols;
+} BoilSpans;
+
+// Fill the h row and w column spans of a w x h glyph boiled with `strength`
+// by the current noise backend
+void boil_spans_build(const BoilSpans *s, const uint8_t *src, int w, int h,
+                      float strength);
+
+// Widen the spans of an area to also cover `src`, spans of a w x h area
+// anchored at the same corner
+void boil_spans_merge(const BoilSpans *dst, const BoilSpans *src, int w,
+                      int h);
+
+// Compute the boil offsets of a w x h area. They only depend on the position
+// within the glyph and on t, so one field can be applied to any glyph that
+// fits in it. With spans, offsets outside them are left at zero instead of
+// evaluating noise there, NULL computes the whole area.
+void boil_field_compute(const BoilField *f, int w, int h,
+                        const BoilSpans *spans, float t, float strength,
+                        float freq);
+
+// Boil fields of `phases` time phases computed up front, so boiling a glyph is
+// only a remap. Times are quantized to multiples of phase_dt and wrap around
+// every `phases` phases: the boil loops, with the memory (2 * w * h bytes
+// per phase) bounding how long.
+typedef struct {
+  int phases;
+  float phase_dt;
+  int w;
+  int h;
+  int8_t *data;
+} BoilCache;
+
+// Compute the fields of every phase for a w x h area, returns 0 if they could
+// not be allocated. Spans are optional as in boil_field_compute().
+int boil_cache_build(BoilCache *c, int phases, float phase_dt, int w, int h,
+                     const BoilSpans *spans, float strength, float freq);
+
+// Phase closest to t
+int boil_cache_phase(const BoilCache *c, float t);
+
+// Field of a phase
+BoilField boil_cache_field(const BoilCache *c, int phase);
+
+void boil_cache_free(BoilCache *c);
+
+// Widest boil offset at a strength, in pixels. Bitmaps are remapped without
+// bounds checks, so they need this many zero pixels around them, and 3 more
+// bytes after the last row for the gather kernels.
+int boil_apron(float strength);
+
+// Remap a w x h glyph through a computed field. src points at the glyph's
+// top-left pixel inside its apron, with rows pitch bytes apart; dst is w x h.
+void boil_field_apply(uint8_t *dst, const uint8_t *src, int pitch, int w,
+                      int h, const BoilField *f);
+
+// Apply boiling effect to a frame, src as in boil_field_apply() and its spans
+// optional as in boil_field_compute()
+void boil_frame(uint8_t *dst, const uint8_t *src, int pitch, int w, int h,
+                const BoilSpans *spans, float t, float strength, float freq);
 
 #endif // VORONOI_H